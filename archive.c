@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <fcntl.h>    // for open, openat, O_NOFOLLOW
+#include <limits.h>   // for PATH_MAX
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h> // for fstat, fstatat
+#include <unistd.h>
+#include <zstd.h>
+
+#include "archive.h"
+
+#define BLOCKSIZE 512
+
+// the layout of a POSIX ustar header block
+struct ustar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+
+/* Compresses the given data into the archive, writing out compressed data
+ * as it becomes available. With end set, also finishes the zstd frame.
+ * Returns 0 on success, otherwise -1.
+ *
+ * zstd's workers only accept a bounded amount of input ahead of the output
+ * we've written, so this blocks (rather than buffering without limit) when
+ * the disk or the compressor can't keep up with the walk.
+ */
+static int archive_compress(struct archive* ar, const void* data, size_t len,
+                            bool end) {
+    ZSTD_inBuffer input = { data, len, 0 };
+    ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
+    bool done = false;
+    while (!done) {
+        ZSTD_outBuffer output = { ar->out, ar->outsize, 0 };
+        size_t remaining = ZSTD_compressStream2(ar->cctx, &output, &input,
+                                                mode);
+        if (ZSTD_isError(remaining)) {
+            fprintf(stderr, "Failed to compress archive: %s\n",
+                    ZSTD_getErrorName(remaining));
+            return -1;
+        }
+
+        for (size_t pos = 0; pos < output.pos;) {
+            ssize_t n = write(ar->fd, ar->out + pos, output.pos - pos);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "Failed to write archive: error %d\n", errno);
+                return -1;
+            }
+            pos += n;
+        }
+
+        done = end ? remaining == 0 : input.pos == input.size;
+    }
+    return 0;
+}
+
+
+/* Writes a zero-terminated octal number into a header field. Returns false
+ * (leaving the field all zeros) if the value doesn't fit, in which case
+ * the caller must store it some other way.
+ */
+static bool format_octal(char* field, size_t width, unsigned long long value) {
+    bool fits = (value >> (3 * (width - 1))) == 0;
+    if (!fits)
+        value = 0;
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i > 0; i--) {
+        field[i - 1] = '0' + (value & 7);
+        value >>= 3;
+    }
+    return fits;
+}
+
+
+/* Writes a pax extended header holding the records in data, which applies
+ * to the following file. Used for values that don't fit in a ustar header.
+ */
+static int archive_pax(struct archive* ar, const char* data, size_t len) {
+    struct ustar_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    strcpy(hdr.name, "././@PaxHeader");
+    format_octal(hdr.mode, sizeof(hdr.mode), 0644);
+    format_octal(hdr.uid, sizeof(hdr.uid), 0);
+    format_octal(hdr.gid, sizeof(hdr.gid), 0);
+    format_octal(hdr.size, sizeof(hdr.size), len);
+    format_octal(hdr.mtime, sizeof(hdr.mtime), 0);
+    hdr.typeflag = 'x';
+    memcpy(hdr.magic, "ustar", 6);
+    memcpy(hdr.version, "00", 2);
+
+    memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+    unsigned int sum = 0;
+    for (size_t i = 0; i < sizeof(hdr); i++)
+        sum += ((unsigned char*) &hdr)[i];
+    format_octal(hdr.chksum, 7, sum);
+
+    static const char zeros[BLOCKSIZE];
+    if (archive_compress(ar, &hdr, sizeof(hdr), false)
+            || archive_compress(ar, data, len, false)
+            || archive_compress(ar, zeros, -len & (BLOCKSIZE - 1), false))
+        return -1;
+    return 0;
+}
+
+
+// the number of decimal digits in n
+static size_t decimal_digits(size_t n) {
+    size_t digits = 1;
+    for (; n >= 10; n /= 10)
+        digits++;
+    return digits;
+}
+
+
+// appends a "<length> key=value\n" pax record, whose length counts itself
+static size_t pax_record(char* buf, const char* key, const char* value) {
+    size_t len = strlen(key) + strlen(value) + 3; // space, '=', newline
+    size_t total = len + decimal_digits(len);
+    total = len + decimal_digits(total); // in case that added a digit
+    return sprintf(buf, "%zu %s=%s\n", total, key, value);
+}
+
+
+/* Writes the header for one file, using a pax extended header first when
+ * the path, link target or size don't fit in the ustar fields.
+ */
+static int archive_header(struct archive* ar, const char* path,
+                          const struct stat* st, const char* linkname) {
+    struct ustar_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    char pax[2 * PATH_MAX + 256];
+    size_t paxlen = 0;
+
+    // ustar stores long paths as a prefix and a name, split at a slash
+    size_t pathlen = strlen(path);
+    if (pathlen <= sizeof(hdr.name)) {
+        memcpy(hdr.name, path, pathlen);
+    } else {
+        const char* split = NULL;
+        if (pathlen <= sizeof(hdr.prefix) + 1 + sizeof(hdr.name)) {
+            split = path + pathlen - sizeof(hdr.name) - 1;
+            split = strchr(split, '/');
+        }
+        if (split && (size_t) (split - path) <= sizeof(hdr.prefix) && split[1]) {
+            memcpy(hdr.prefix, path, split - path);
+            memcpy(hdr.name, split + 1, strlen(split + 1));
+        } else {
+            memcpy(hdr.name, path, sizeof(hdr.name));
+            paxlen += pax_record(pax + paxlen, "path", path);
+        }
+    }
+
+    if (linkname) {
+        size_t linklen = strlen(linkname);
+        if (linklen <= sizeof(hdr.linkname)) {
+            memcpy(hdr.linkname, linkname, linklen);
+        } else {
+            memcpy(hdr.linkname, linkname, sizeof(hdr.linkname));
+            paxlen += pax_record(pax + paxlen, "linkpath", linkname);
+        }
+    }
+
+    unsigned long long size = linkname ? 0 : st->st_size;
+    if (!format_octal(hdr.size, sizeof(hdr.size), size)) {
+        char value[32];
+        sprintf(value, "%llu", size);
+        paxlen += pax_record(pax + paxlen, "size", value);
+    }
+
+    format_octal(hdr.mode, sizeof(hdr.mode), st->st_mode & 07777);
+    // ids too large for ustar (e.g. in user namespaces) go in pax records,
+    // never 0, which would restore a setuid file as owned by root
+    char id[32];
+    if (!format_octal(hdr.uid, sizeof(hdr.uid), st->st_uid)) {
+        sprintf(id, "%llu", (unsigned long long) st->st_uid);
+        paxlen += pax_record(pax + paxlen, "uid", id);
+    }
+    if (!format_octal(hdr.gid, sizeof(hdr.gid), st->st_gid)) {
+        sprintf(id, "%llu", (unsigned long long) st->st_gid);
+        paxlen += pax_record(pax + paxlen, "gid", id);
+    }
+    format_octal(hdr.mtime, sizeof(hdr.mtime),
+                 st->st_mtime > 0 ? st->st_mtime : 0);
+    hdr.typeflag = linkname ? '2' : '0';
+    memcpy(hdr.magic, "ustar", 6);
+    memcpy(hdr.version, "00", 2);
+
+    memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+    unsigned int sum = 0;
+    for (size_t i = 0; i < sizeof(hdr); i++)
+        sum += ((unsigned char*) &hdr)[i];
+    format_octal(hdr.chksum, 7, sum);
+
+    if (paxlen && archive_pax(ar, pax, paxlen))
+        return -1;
+    return archive_compress(ar, &hdr, sizeof(hdr), false);
+}
+
+
+/* Creates the archive file at path and sets up compression. Returns 0 on
+ * success, otherwise -1.
+ *
+ * Compression runs on one zstd worker thread per CPU; if libzstd was built
+ * without threading support, it falls back to compressing inline.
+ */
+int archive_open(struct archive* ar, const char* path) {
+    memset(ar, 0, sizeof(*ar));
+    ar->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (ar->fd == -1) {
+        fprintf(stderr, "Cannot create archive '%s': %s\n",
+                path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(ar->fd, &st) == 0) {
+        ar->dev = st.st_dev;
+        ar->ino = st.st_ino;
+    }
+
+    ar->cctx = ZSTD_createCCtx();
+    ar->insize = ZSTD_CStreamInSize();
+    ar->in = malloc(ar->insize);
+    ar->outsize = ZSTD_CStreamOutSize();
+    ar->out = malloc(ar->outsize);
+    if (ar->cctx == NULL || ar->in == NULL || ar->out == NULL) {
+        fprintf(stderr, "failed to allocate memory for archive\n");
+        return -1;
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus > 1)
+        ZSTD_CCtx_setParameter(ar->cctx, ZSTD_c_nbWorkers, ncpus);
+    return 0;
+}
+
+
+/* Writes the file name, in the directory open at dirfd, into the archive
+ * as path. Files that can't be read are skipped with a warning (unless
+ * silent), since they're still reported; returns -1 only if the archive
+ * itself can't be written.
+ *
+ * A file that changes size while it's being read is truncated or padded
+ * with zeros to the size it had when opened, to keep the archive valid.
+ */
+int archive_add(struct archive* ar, int dirfd, const char* name,
+                const char* path, bool symlink, bool silent) {
+    // tar members are relative, extract them with tar -C ROOT
+    while (*path == '/')
+        path++;
+
+    struct stat st;
+    if (symlink) {
+        char target[PATH_MAX];
+        ssize_t len;
+        if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1
+                || (len = readlinkat(dirfd, name, target,
+                                     sizeof(target) - 1)) == -1) {
+            if (!silent)
+                fprintf(stderr, "Cannot archive '%s': %s\n",
+                        path, strerror(errno));
+            return 0;
+        }
+        target[len] = '\0';
+        return archive_header(ar, path, &st, target);
+    }
+
+    // O_NONBLOCK so a FIFO swapped in since getdents can't block the walk
+    int fd = openat(dirfd, name,
+                    O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (!silent)
+            fprintf(stderr, "Cannot archive '%s': %s\n",
+                    path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return 0;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        if (!silent)
+            fprintf(stderr, "Cannot archive '%s': no longer a regular file\n",
+                    path);
+        close(fd);
+        return 0;
+    }
+    if (st.st_dev == ar->dev && st.st_ino == ar->ino) {
+        close(fd);
+        return 0;
+    }
+
+    if (archive_header(ar, path, &st, NULL)) {
+        close(fd);
+        return -1;
+    }
+
+    off_t left = st.st_size;
+    bool readable = true;
+    while (left > 0) {
+        size_t want = (size_t) left < ar->insize ? (size_t) left : ar->insize;
+        ssize_t n = readable ? read(fd, ar->in, want) : 0;
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && !silent)
+            fprintf(stderr, "Failed to read '%s': %s\n",
+                    path, strerror(errno));
+        if (n <= 0) {
+            // stop reading, and pad out the size promised in the header
+            readable = false;
+            n = want;
+            memset(ar->in, 0, n);
+        }
+        if (archive_compress(ar, ar->in, n, false)) {
+            close(fd);
+            return -1;
+        }
+        left -= n;
+    }
+    close(fd);
+
+    static const char zeros[BLOCKSIZE];
+    return archive_compress(ar, zeros, -st.st_size & (BLOCKSIZE - 1), false);
+}
+
+
+/* Writes the end-of-archive marker, finishes compression and closes the
+ * file. Returns 0 on success, otherwise -1.
+ */
+int archive_close(struct archive* ar) {
+    static const char zeros[2 * BLOCKSIZE];
+    int ret = archive_compress(ar, zeros, sizeof(zeros), true);
+
+    if (close(ar->fd) == -1 && ret == 0) {
+        fprintf(stderr, "Failed to write archive: error %d\n", errno);
+        ret = -1;
+    }
+    ZSTD_freeCCtx(ar->cctx);
+    free(ar->in);
+    free(ar->out);
+    return ret;
+}
@@ -0,0 +1,21 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h> // for dev_t, ino_t
+#include <zstd.h>      // for ZSTD_CCtx
+
+// a zstd-compressed tar stream that files are written into as they're found
+struct archive {
+    int fd;            // the output file
+    dev_t dev;         // device and inode of the output file, so that it
+    ino_t ino;         //   isn't archived into itself
+    ZSTD_CCtx* cctx;   // compression context, with its own worker threads
+    char* in;          // staging buffer for tar headers and file contents
+    size_t insize;
+    char* out;         // compressed data waiting to be written
+    size_t outsize;
+};
+
+int archive_open(struct archive* ar, const char* path);
+int archive_add(struct archive* ar, int dirfd, const char* name,
+                const char* path, bool symlink, bool silent);
+int archive_close(struct archive* ar);
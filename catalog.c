@@ -0,0 +1,103 @@
+#include <assert.h>
+#include <fnmatch.h>  // for fnmatch
+#include <stdbool.h>
+#include <stdlib.h>   // for bsearch
+#include <string.h>
+
+#include "catalog.h"
+
+
+/* A catalog of files that aren't in any package, but are generated on every
+ * Arch system by alpm hooks (or by programs at runtime), so reporting them
+ * isn't useful. Paths are relative to the root, like the package database.
+ *
+ * The walker only checks files that weren't in the hashset, so these tables
+ * don't slow down the common case.
+ */
+
+// exact paths; must stay sorted (in strcmp order) for bsearch, which is
+// asserted on first use unless built with NDEBUG
+static const char* const generated_paths[] = {
+    "etc/ld.so.cache",                                  // ldconfig
+    "etc/udev/hwdb.bin",                                // systemd-hwdb
+    "usr/lib/gdk-pixbuf-2.0/2.10.0/loaders.cache",      // gdk-pixbuf2
+    "usr/lib/gio/modules/giomodule.cache",              // glib2
+    "usr/lib/gtk-2.0/2.10.0/immodules.cache",           // gtk2
+    "usr/lib/gtk-3.0/3.0.0/immodules.cache",            // gtk3
+    "usr/lib/locale/locale-archive",                    // locale-gen
+    "usr/lib/udev/hwdb.bin",                            // systemd-hwdb
+    "usr/share/applications/mimeinfo.cache",            // desktop-file-utils
+    "usr/share/glib-2.0/schemas/gschemas.compiled",     // glib2
+    "usr/share/info/dir",                               // texinfo
+    "var/cache/ldconfig/aux-cache",                     // ldconfig
+};
+
+// fnmatch patterns, without FNM_PATHNAME so that '*' also matches '/'
+static const char* const generated_patterns[] = {
+    "*/__pycache__/*",                                  // python
+    "etc/ca-certificates/extracted/*",                  // update-ca-trust
+    "usr/lib/modules/*/modules.*",                      // depmod
+    "usr/share/fonts/*/fonts.dir",                      // mkfontdir
+    "usr/share/fonts/*/fonts.scale",                    // mkfontscale
+    "usr/share/icons/*/icon-theme.cache",               // gtk-update-icon-cache
+    "usr/share/mime/*",                                 // update-mime-database
+    "var/cache/fontconfig/*",                           // fc-cache
+};
+
+// like generated_patterns, but only matched by symlinks, for directories
+// where hand-placed files are worth reporting
+static const char* const generated_link_patterns[] = {
+    "etc/ssl/certs/*",                                  // update-ca-trust
+};
+
+// exceptions to the patterns above, where files are installed by hand
+static const char* const source_patterns[] = {
+    "usr/share/mime/packages/*",                        // mime definitions
+};
+
+
+static int compare_path(const void* key, const void* entry) {
+    return strcmp(key, *(const char* const*) entry);
+}
+
+
+// whether rel_path (a symlink, if symlink is set) is a known generated file
+bool catalog_contains(const char* rel_path, bool symlink) {
+#ifndef NDEBUG
+    // a misplaced entry would silently stop matching, so check once
+    static bool checked = false;
+    if (!checked) {
+        for (size_t i = 1;
+             i < sizeof(generated_paths) / sizeof(*generated_paths); i++)
+            assert(strcmp(generated_paths[i - 1], generated_paths[i]) < 0);
+        checked = true;
+    }
+#endif
+
+    if (bsearch(rel_path, generated_paths,
+                sizeof(generated_paths) / sizeof(*generated_paths),
+                sizeof(*generated_paths), compare_path))
+        return true;
+
+    for (size_t i = 0;
+         i < sizeof(source_patterns) / sizeof(*source_patterns); i++) {
+        if (!fnmatch(source_patterns[i], rel_path, 0))
+            return false;
+    }
+
+    for (size_t i = 0;
+         i < sizeof(generated_patterns) / sizeof(*generated_patterns); i++) {
+        if (!fnmatch(generated_patterns[i], rel_path, 0))
+            return true;
+    }
+
+    if (!symlink)
+        return false;
+    for (size_t i = 0;
+         i < sizeof(generated_link_patterns) / sizeof(*generated_link_patterns);
+         i++) {
+        if (!fnmatch(generated_link_patterns[i], rel_path, 0))
+            return true;
+    }
+    return false;
+}
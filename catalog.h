@@ -0,0 +1,6 @@
+#include <stdbool.h>
+
+// bump whenever the catalog's entries change
+#define CATALOG_VERSION "2"
+
+bool catalog_contains(const char* rel_path, bool symlink);
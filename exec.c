@@ -0,0 +1,188 @@
+#define _GNU_SOURCE   // for posix_spawn_file_actions_addfchdir_np
+#include <errno.h>
+#include <spawn.h>    // for posix_spawnp, posix_spawn_file_actions_t
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h> // for waitpid, WIFEXITED, WEXITSTATUS
+#include <unistd.h>   // for sysconf, _SC_ARG_MAX
+
+#include "exec.h"
+
+extern char** environ;
+
+// room left for the kernel's own bookkeeping (auxv, program path, etc.)
+#define ARG_HEADROOM 2048
+
+
+/* Initializes a batch for the given command. Returns 0 on success, -1 if
+ * the command can't be run with any file names at all.
+ *
+ * The size of a batch is limited by ARG_MAX, less the size of the current
+ * environment and of the command itself, like `xargs` does.
+ */
+int exec_batch_init(struct exec_batch* eb, char** cmd, size_t ncmd,
+                    size_t maxprocs) {
+    memset(eb, 0, sizeof(*eb));
+    eb->cmd = cmd;
+    eb->ncmd = ncmd;
+    eb->maxprocs = maxprocs ? maxprocs : 1;
+
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0)
+        arg_max = 131072; // POSIX only guarantees 4096, but Linux never less
+
+    long used = ARG_HEADROOM + sizeof(char*); // argv's NULL terminator
+    for (char** env = environ; *env; env++)
+        used += strlen(*env) + 1 + sizeof(char*);
+    used += sizeof(char*); // envp's NULL terminator
+    for (size_t i = 0; i < ncmd; i++)
+        used += strlen(cmd[i]) + 1 + sizeof(char*);
+
+    if (used >= arg_max) {
+        fprintf(stderr, "Command for --exec is too long\n");
+        return -1;
+    }
+    eb->bufsize = arg_max - used;
+
+    eb->buf = malloc(eb->bufsize);
+    eb->maxargs = 64;
+    eb->argv = malloc((ncmd + eb->maxargs + 1) * sizeof(char*));
+    if (eb->buf == NULL || eb->argv == NULL) {
+        fprintf(stderr, "failed to allocate memory for --exec\n");
+        return -1;
+    }
+    memcpy(eb->argv, cmd, ncmd * sizeof(char*));
+    return 0;
+}
+
+
+/* Waits for one running batch to exit and records whether it failed.
+ * Returns 0 unless waiting itself failed.
+ */
+static int exec_batch_reap(struct exec_batch* eb) {
+    int status;
+    pid_t pid;
+    do {
+        pid = waitpid(-1, &status, 0);
+    } while (pid == -1 && errno == EINTR);
+    if (pid == -1) {
+        fprintf(stderr, "Failed to wait for --exec command: error %d\n", errno);
+        return -1;
+    }
+    eb->running--;
+
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "%s: terminated by signal %d\n",
+                eb->cmd[0], WTERMSIG(status));
+        eb->failed = true;
+    } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        eb->failed = true;
+    }
+    return 0;
+}
+
+
+/* Adds a file in the directory open at dirfd to the current batch, first
+ * running the batch if the name doesn't fit. Returns 0 unless an error
+ * occurred, otherwise -1.
+ *
+ * Names are passed as "./name" so that they can't be mistaken for options.
+ */
+int exec_batch_add(struct exec_batch* eb, int dirfd, const char* name) {
+    size_t len = strlen(name) + 3; // "./" prefix and NUL
+    if (eb->buflen + len + sizeof(char*) > eb->bufsize) {
+        if (eb->nargs == 0) {
+            fprintf(stderr, "File name too long for --exec: %s\n", name);
+            return -1;
+        }
+        if (exec_batch_flush(eb, dirfd))
+            return -1;
+    }
+
+    if (eb->nargs == eb->maxargs) {
+        size_t maxargs = eb->maxargs * 2;
+        char** argv = realloc(eb->argv,
+                              (eb->ncmd + maxargs + 1) * sizeof(char*));
+        if (argv == NULL) {
+            fprintf(stderr, "failed to allocate memory for --exec\n");
+            return -1;
+        }
+        eb->argv = argv;
+        eb->maxargs = maxargs;
+    }
+
+    char* arg = eb->buf + eb->buflen;
+    arg[0] = '.';
+    arg[1] = '/';
+    strcpy(arg + 2, name);
+    eb->argv[eb->ncmd + eb->nargs] = arg;
+    eb->nargs++;
+    eb->buflen += len + sizeof(char*);
+    return 0;
+}
+
+
+/* Runs the command on the current batch, with dirfd as its working
+ * directory, and starts a new batch. Does nothing for an empty batch.
+ * Returns 0 unless the command couldn't be started, otherwise -1.
+ *
+ * If maxprocs batches are already running, waits for one to finish first.
+ * posix_spawn returns only once the child has changed directory and exec'd,
+ * so the caller is free to close dirfd and reuse the batch right away.
+ */
+int exec_batch_flush(struct exec_batch* eb, int dirfd) {
+    if (eb->nargs == 0)
+        return 0;
+
+    while (eb->running >= eb->maxprocs) {
+        if (exec_batch_reap(eb))
+            return -1;
+    }
+
+    eb->argv[eb->ncmd + eb->nargs] = NULL;
+
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int err = posix_spawn_file_actions_init(&actions);
+    if (err == 0) {
+        // without the fchdir, the ./name arguments would resolve elsewhere
+        err = posix_spawn_file_actions_addfchdir_np(&actions, dirfd);
+        if (err == 0)
+            err = posix_spawnp(&pid, eb->cmd[0], &actions, NULL,
+                               eb->argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    if (err) {
+        fprintf(stderr, "Cannot run '%s': %s\n", eb->cmd[0], strerror(err));
+        return -1;
+    }
+
+    eb->running++;
+    eb->nargs = 0;
+    eb->buflen = 0;
+    return 0;
+}
+
+
+/* Waits for every running batch and frees the batch's memory. The current
+ * batch must already have been flushed. Returns 0 if every command
+ * succeeded, 1 if any failed and -1 if waiting failed.
+ */
+int exec_batch_finish(struct exec_batch* eb) {
+    int ret = 0;
+    while (eb->running > 0) {
+        if (exec_batch_reap(eb)) {
+            ret = -1;
+            break;
+        }
+    }
+
+    free(eb->buf);
+    free(eb->argv);
+
+    if (ret == 0 && eb->failed)
+        ret = 1;
+    return ret;
+}
@@ -0,0 +1,26 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h> // for pid_t
+
+// accumulates file names for one directory and runs a command on them in
+// batches, in the style of `find -execdir CMD {} +`
+struct exec_batch {
+    char** cmd;        // command words preceding the {} placeholder
+    size_t ncmd;       // number of command words
+    size_t maxprocs;   // maximum number of batches running at once
+    size_t running;    // number of batches currently running
+    bool failed;       // whether any batch exited unsuccessfully
+
+    char** argv;       // argument vector: cmd words, then file names, then NULL
+    size_t nargs;      // number of file names in the current batch
+    size_t maxargs;    // capacity for file names in argv
+    char* buf;         // storage for the file names in the current batch
+    size_t buflen;     // bytes used in buf
+    size_t bufsize;    // maximum bytes of file names per batch
+};
+
+int exec_batch_init(struct exec_batch* eb, char** cmd, size_t ncmd,
+                    size_t maxprocs);
+int exec_batch_add(struct exec_batch* eb, int dirfd, const char* name);
+int exec_batch_flush(struct exec_batch* eb, int dirfd);
+int exec_batch_finish(struct exec_batch* eb);
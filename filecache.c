@@ -0,0 +1,267 @@
+#include <alpm.h>
+#include <errno.h>
+#include <fcntl.h>     // for open, O_RDONLY
+#include <glib.h>      // for g_hash_table_add
+#include <limits.h>    // for PATH_MAX
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>  // for mmap, munmap
+#include <sys/stat.h>  // for fstat, mkdir, fchmod
+#include <unistd.h>
+
+#include "filecache.h"
+
+#define FILECACHE_MAGIC "FUFLIST1"
+
+
+/* Opens (creating if necessary) a cache directory. Returns 0 on success,
+ * otherwise -1.
+ */
+int filecache_open(struct filecache* fc, const char* dir) {
+    memset(fc, 0, sizeof(*fc));
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create cache directory '%s': %s\n",
+                dir, strerror(errno));
+        return -1;
+    }
+    fc->dir = malloc(strlen(dir) + 1);
+    strcpy(fc->dir, dir);
+    errno = 0;
+    return 0;
+}
+
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+
+// the final mixing step of MurmurHash3, so every input bit affects the key
+static inline uint64_t fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+/* A 128-bit hash of data, in two independent lanes of one multiply per
+ * 8-byte word. It isn't collision resistant against deliberate attacks, but
+ * anyone who can write to the cache directory can plant a file list anyway;
+ * against accidental collisions 128 bits is plenty.
+ */
+static void filecache_digest(const unsigned char* data, size_t len,
+                             uint64_t out[2]) {
+    uint64_t h1 = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t h2 = 0x6a09e667f3bcc909ULL ^ len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h1 = rotl64(h1 ^ w, 29) * 0x87c37b91114253d5ULL;
+        h2 = rotl64(h2 + w, 31) * 0x4cf5ad432745937fULL;
+    }
+    uint64_t w = 0;
+    memcpy(&w, data + i, len - i);
+    h1 = rotl64(h1 ^ w, 29) * 0x87c37b91114253d5ULL;
+    h2 = rotl64(h2 + w, 31) * 0x4cf5ad432745937fULL;
+
+    h1 = fmix64(h1 + h2);
+    h2 = fmix64(h2 + h1);
+    out[0] = h1;
+    out[1] = h2;
+}
+
+
+/* Hashes the package's `files` entry in the local database into fc->key.
+ * Returns 0 on success, otherwise -1 (e.g. for a database without one).
+ *
+ * This runs on every lookup, hits included, so it uses a cheap hash rather
+ * than a cryptographic one, over a buffer reused between packages. (Mapping
+ * each entry instead costs more in page faults than it saves in copying.)
+ */
+static int filecache_hash(struct filecache* fc, const char* db,
+                          alpm_pkg_t* pkg) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/local/%s-%s/files", db,
+             alpm_pkg_get_name(pkg), alpm_pkg_get_version(pkg));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t) st.st_size > fc->bufsize) {
+        char* buf = realloc(fc->buf, st.st_size);
+        if (buf == NULL) {
+            close(fd);
+            return -1;
+        }
+        fc->buf = buf;
+        fc->bufsize = st.st_size;
+    }
+
+    size_t len = 0;
+    while (len < (size_t) st.st_size) {
+        ssize_t n = read(fd, fc->buf + len, st.st_size - len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    close(fd);
+    if (len != (size_t) st.st_size)
+        return -1;
+
+    uint64_t digest[2];
+    filecache_digest((const unsigned char*) fc->buf, len, digest);
+    snprintf(fc->key, sizeof(fc->key), "%016llx%016llx",
+             (unsigned long long) digest[0], (unsigned long long) digest[1]);
+    return 0;
+}
+
+
+/* Adds the package's files to the hashset from the cache, if its file list
+ * was cached before. Returns true on a hit; on a miss, the caller should
+ * read the file list from alpm and pass it to filecache_store.
+ *
+ * The blob is mapped rather than read, and the hashset points straight into
+ * the mapping, so a hit costs little more than hashing the `files` entry
+ * and touching pages that are usually already in the page cache.
+ */
+bool filecache_load(struct filecache* fc, const char* db, alpm_pkg_t* pkg,
+                    GHashTable* hs) {
+    fc->key[0] = '\0';
+    if (filecache_hash(fc, db, pkg))
+        return false;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", fc->dir, fc->key);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1
+            || (size_t) st.st_size < sizeof(struct filecache_header)) {
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    // anything unexpected is treated as a miss, and will be overwritten
+    const struct filecache_header* hdr = addr;
+    char* data = (char*) addr + sizeof(*hdr);
+    if (memcmp(hdr->magic, FILECACHE_MAGIC, sizeof(hdr->magic))
+            || hdr->size != st.st_size - sizeof(*hdr)
+            || (hdr->size && data[hdr->size - 1] != '\0')) {
+        munmap(addr, st.st_size);
+        return false;
+    }
+
+    struct filecache_map* map = malloc(sizeof(*map));
+    if (map == NULL) {
+        fprintf(stderr, "failed to allocate memory for cache\n");
+        munmap(addr, st.st_size);
+        return false;
+    }
+    map->addr = addr;
+    map->len = st.st_size;
+    map->next = fc->maps;
+    fc->maps = map;
+
+    for (char* p = data; p < data + hdr->size; p += strlen(p) + 1)
+        g_hash_table_add(hs, p);
+    return true;
+}
+
+
+/* Stores a file list under the key of the last filecache_load miss.
+ * Failing to store only warns, since the file list is still used.
+ *
+ * The blob is written to a temporary file and renamed into place, so other
+ * invocations sharing the cache never map a partial blob.
+ */
+void filecache_store(struct filecache* fc, alpm_filelist_t* filelist) {
+    if (!fc->key[0] || fc->failed)
+        return;
+
+    struct filecache_header hdr;
+    memcpy(hdr.magic, FILECACHE_MAGIC, sizeof(hdr.magic));
+    hdr.count = filelist->count;
+    hdr.size = 0;
+    for (size_t i = 0; i < filelist->count; i++)
+        hdr.size += strlen(filelist->files[i].name) + 1;
+
+    size_t len = sizeof(hdr) + hdr.size;
+    char* blob = malloc(len);
+    if (blob == NULL) {
+        fprintf(stderr, "failed to allocate memory for cache\n");
+        fc->failed = true;
+        return;
+    }
+    memcpy(blob, &hdr, sizeof(hdr));
+    char* p = blob + sizeof(hdr);
+    for (size_t i = 0; i < filelist->count; i++) {
+        size_t namelen = strlen(filelist->files[i].name) + 1;
+        memcpy(p, filelist->files[i].name, namelen);
+        p += namelen;
+    }
+
+    char tmp[PATH_MAX];
+    char path[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", fc->dir);
+    snprintf(path, sizeof(path), "%s/%s", fc->dir, fc->key);
+    int fd = mkstemp(tmp);
+    bool ok = fd != -1;
+    for (size_t pos = 0; ok && pos < len;) {
+        ssize_t n = write(fd, blob + pos, len - pos);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            ok = false;
+            break;
+        }
+        pos += n;
+    }
+    // blobs are shared by everyone using the cache directory
+    ok = ok && fchmod(fd, 0644) == 0;
+    if (fd != -1)
+        ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    free(blob);
+
+    if (!ok) {
+        fprintf(stderr, "Cannot write to cache directory '%s': %s\n",
+                fc->dir, strerror(errno));
+        if (fd != -1)
+            unlink(tmp);
+        fc->failed = true;
+    }
+    errno = 0;
+}
+
+
+// unmaps all blobs; the hashset built from them must not be used afterwards
+void filecache_close(struct filecache* fc) {
+    while (fc->maps) {
+        struct filecache_map* next = fc->maps->next;
+        munmap(fc->maps->addr, fc->maps->len);
+        free(fc->maps);
+        fc->maps = next;
+    }
+    free(fc->buf);
+    free(fc->dir);
+}
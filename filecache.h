@@ -0,0 +1,37 @@
+#include <alpm.h>
+#include <glib.h>     // for GHashTable
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// header of a cached file list; followed by `size` bytes of NUL-terminated
+// paths, in the order the package database lists them
+struct filecache_header {
+    char magic[8];     // FILECACHE_MAGIC, which includes the format version
+    uint64_t count;    // number of paths
+    uint64_t size;     // bytes of path data following the header
+};
+
+// a mapped cache blob, kept until the hashset that points into it is gone
+struct filecache_map {
+    void* addr;
+    size_t len;
+    struct filecache_map* next;
+};
+
+// a directory of file lists, named by a 128-bit hash of the package's `files`
+// entry in the database, that can be shared by any number of databases
+struct filecache {
+    char* dir;
+    char key[33];      // hex hash of the last package looked up
+    bool failed;       // whether storing has failed (to only warn once)
+    char* buf;         // holds each `files` entry while it's hashed
+    size_t bufsize;
+    struct filecache_map* maps;
+};
+
+int filecache_open(struct filecache* fc, const char* dir);
+bool filecache_load(struct filecache* fc, const char* db, alpm_pkg_t* pkg,
+                    GHashTable* hs);
+void filecache_store(struct filecache* fc, alpm_filelist_t* filelist);
+void filecache_close(struct filecache* fc);
@@ -12,17 +12,22 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "archive.h"
+#include "catalog.h"
+#include "exec.h"
+#include "filecache.h"
 #include "walkfd.h"
 
 
 /* Program structure:
  *
  *  1. Open a handle to an alpm database at a user specified location.
- *  2. Creates a hashset with every filepath part of an installed package.
+ *  2. Creates a hashset with every filepath part of an installed package,
+ *     optionally mapping file lists cached by a previous run.
  *  3. Given a list of user specified paths, the program recursively walks
  *     the file system for each path, and for each file (and optionally
  *     symlink) checks whether it is part of an installed package, and if
- *     not, prints it.
+ *     not, prints it (or, with --exec, runs a command on it in batches).
  */
 
 
@@ -36,7 +41,19 @@ static const char* const helptext =
     "  -d, --db=DIR         Specifies the location of the Pacman database\n"
     "                         (default DIR: /var/lib/pacman)\n"
     "  -n, --no-symlinks    Disables checking the package database for symlinks\n"
-    "  -q, --quiet          Disables printing an error upon access failures\n\n\n"
+    "  -q, --quiet          Disables printing an error upon access failures\n"
+    "  -c, --cache=DIR      Caches parsed package file lists in DIR, which can be\n"
+    "                         shared between databases (e.g. in containers)\n"
+    "  -g, --generated      Includes files that alpm hooks generate on every system,\n"
+    "                         like ld.so.cache (hidden by default; catalog v"
+    CATALOG_VERSION ")\n"
+    "  -x, --exec CMD [ARG]... {} +\n"
+    "                       Runs CMD on untracked files instead of printing them,\n"
+    "                         as many files per run as fit, from within the\n"
+    "                         directory containing them (like find -execdir)\n"
+    "  -P, --max-procs=N    Runs up to N commands for --exec at once (default: 1)\n"
+    "  -a, --archive=FILE   Also writes untracked files into FILE as a\n"
+    "                         zstd-compressed tar archive (paths relative to root)\n\n\n"
     "Issue tracker: https://github.com/afontenot/find-untracked-files\n"
     "License: GPL-3.0-or-greater https://www.gnu.org/licenses/gpl-3.0.en.html\n";
 
@@ -51,6 +68,12 @@ int main(int argc, char* argv[]) {
     strcpy(db, default_db);
     bool nosymlinks = false;
     bool silent = false;
+    bool generated = false;
+    char** exec_cmd = NULL;
+    size_t exec_ncmd = 0;
+    size_t maxprocs = 0; // 0 if not given, which means 1
+    char* archive_path = NULL;
+    char* cache_dir = NULL;
 
     // parse arguments
     while (true) {
@@ -61,11 +84,16 @@ int main(int argc, char* argv[]) {
             {"db",          required_argument, NULL, 'd'},
             {"no-symlinks", no_argument,       NULL, 'n'},
             {"quiet",       no_argument,       NULL, 'q'},
+            {"generated",   no_argument,       NULL, 'g'},
+            {"cache",       required_argument, NULL, 'c'},
+            {"exec",        required_argument, NULL, 'x'},
+            {"max-procs",   required_argument, NULL, 'P'},
+            {"archive",     required_argument, NULL, 'a'},
             {"help",        no_argument,       NULL, 'h'},
             {NULL,          0,                 NULL,  0 }
         };
 
-        opt = getopt_long(argc, argv, "r:d:nqh", long_options, &option_index);
+        opt = getopt_long(argc, argv, "r:d:nqgc:x:P:a:h", long_options, &option_index);
         if (opt == -1)
             break;
 
@@ -96,6 +124,60 @@ int main(int argc, char* argv[]) {
             silent = true;
             break;
 
+        case 'g':
+            generated = true;
+            break;
+
+        case 'c':
+            cache_dir = optarg;
+            break;
+
+        case 'x': {
+            // the command runs up to a "{} +" terminator; consume its words
+            // here, and copy them, since getopt reorders argv as it goes
+            int first = optind;
+            while (optind < argc && strcmp(argv[optind], "+"))
+                optind++;
+            const char* last = optind > first ? argv[optind - 1] : optarg;
+            if (optind >= argc || strcmp(last, "{}")) {
+                fprintf(stderr, "--exec command must end with '{} +'\n");
+                exit(EXIT_FAILURE);
+            }
+            exec_ncmd = optind - first; // optarg, but not the "{}"
+            optind++; // skip the "+"
+            if (exec_ncmd == 0) {
+                fprintf(stderr, "--exec requires a command\n");
+                exit(EXIT_FAILURE);
+            }
+
+            free(exec_cmd);
+            exec_cmd = malloc(exec_ncmd * sizeof(char*));
+            if (exec_cmd == NULL) {
+                fprintf(stderr, "failed to malloc --exec command\n");
+                exit(EXIT_FAILURE);
+            }
+            exec_cmd[0] = optarg;
+            for (size_t i = 1; i < exec_ncmd; i++)
+                exec_cmd[i] = argv[first + i - 1];
+            break;
+        }
+
+        case 'P': {
+            char* end;
+            errno = 0;
+            long n = strtol(optarg, &end, 10);
+            if (errno || *end || n < 1) {
+                fprintf(stderr, "invalid number for --max-procs: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            maxprocs = n;
+            break;
+        }
+
+        case 'a':
+            archive_path = optarg;
+            break;
+
         case 'h':
             printf(helptext, argv[0]);
             exit(EXIT_SUCCESS);
@@ -110,12 +192,27 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (maxprocs && !exec_cmd) {
+        fprintf(stderr, "--max-procs requires --exec\n");
+        exit(EXIT_FAILURE);
+    }
+
     if (optind >= argc) {
         fprintf(stderr, "No directory specified to search.\n\n");
         printf(helptext, argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    // set up batches for --exec
+    struct exec_batch eb;
+    if (exec_cmd && exec_batch_init(&eb, exec_cmd, exec_ncmd, maxprocs))
+        exit(EXIT_FAILURE);
+
+    // create the archive before the walk, so it can't be found by it
+    struct archive ar;
+    if (archive_path && archive_open(&ar, archive_path))
+        exit(EXIT_FAILURE);
+
     // initialize hash set
     GHashTable* hs = g_hash_table_new(g_str_hash, g_str_equal);
 
@@ -136,16 +233,39 @@ int main(int argc, char* argv[]) {
     // get a list of local packages
     alpm_list_t* pkgs = alpm_db_get_pkgcache(localdb);
 
+    // open the shared cache of file lists, if any
+    struct filecache fc;
+    if (cache_dir && filecache_open(&fc, cache_dir))
+        exit(EXIT_FAILURE);
+
     // loop over local packages, add to set
     for (alpm_list_t* lp = pkgs; lp; lp = alpm_list_next(lp)) {
         alpm_pkg_t* pkg = lp->data;
+
+        // a cached file list saves alpm from reading and parsing it again
+        if (cache_dir && filecache_load(&fc, db, pkg, hs))
+            continue;
+
         alpm_filelist_t* filelist = alpm_pkg_get_files(pkg);
         for(size_t i = 0; i < filelist->count; i++) {
             const alpm_file_t* file = filelist->files + i;
             g_hash_table_add(hs, file->name);
         }
+
+        if (cache_dir)
+            filecache_store(&fc, filelist);
     }
 
+    struct walkopts opts = {
+        .root = root,
+        .symlinks = !nosymlinks,
+        .silent = silent,
+        .generated = generated,
+        .hs = hs,
+        .exec = exec_cmd ? &eb : NULL,
+        .archive = archive_path ? &ar : NULL,
+    };
+
     // remaining args are all user-chosen paths to search
     for (size_t i = optind; i < argc; i++) {
         char* path = malloc(PATH_MAX);
@@ -166,8 +286,8 @@ int main(int argc, char* argv[]) {
         char* alpm_path = path + strlen(root);
 
         // walk through file system
-        int fd = open(path, O_DIRECTORY | O_RDONLY);
-        int walkerr = walkfd(fd, root, alpm_path, !nosymlinks, silent, hs);
+        int fd = open(path, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+        int walkerr = walkfd(fd, alpm_path, &opts);
         close(fd);
         if (walkerr) {
             if (errno)
@@ -178,15 +298,27 @@ int main(int argc, char* argv[]) {
         free(path);
     }
 
+    // wait for any commands still running
+    int exit_status = EXIT_SUCCESS;
+    if (exec_cmd && exec_batch_finish(&eb))
+        exit_status = EXIT_FAILURE;
+
+    // finish the archive
+    if (archive_path && archive_close(&ar))
+        exit_status = EXIT_FAILURE;
+
     // clean up alpm
     alpm_release(handle);
 
-    // clean up hashset
+    // clean up hashset, then the cached file lists it points into
     g_hash_table_destroy(hs);
+    if (cache_dir)
+        filecache_close(&fc);
 
     // free strings for arguments
     free(root);
     free(db);
+    free(exec_cmd);
 
-    exit(EXIT_SUCCESS);
+    exit(exit_status);
 }
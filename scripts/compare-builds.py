@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Builds find-untracked-files in several configurations and benchmarks each.
+
+Each configuration gets its own build directory under BUILDDIR, and all of
+them run the same workload (scripts/workload.py, with --cache) against one
+synthetic root, so their timings can be compared directly. The PGO build
+is trained with the pgo-train target before it's rebuilt with the profile.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+
+CONFIGS = {
+    "default": [],
+    "lto": ["-Db_lto=true"],
+    "pgo": ["-Db_pgo=generate"],
+    "static": ["-Dstatic=true"],
+}
+
+
+def build(source, builddir, name, options):
+    path = os.path.join(builddir, name)
+    if not os.path.exists(os.path.join(path, "build.ninja")):
+        subprocess.run(["meson", "setup", path, source] + options, check=True)
+    subprocess.run(["ninja", "-C", path], check=True)
+    if name == "pgo":
+        subprocess.run(["ninja", "-C", path, "pgo-train"], check=True)
+        subprocess.run(["meson", "configure", path, "-Db_pgo=use"], check=True)
+        subprocess.run(["ninja", "-C", path], check=True)
+    return os.path.join(path, "find-untracked-files")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("builddir", help="directory for the build directories")
+    parser.add_argument("--runs", type=int, default=10,
+                        help="number of timed runs per build (default: 10)")
+    parser.add_argument("configs", nargs="*", default=list(CONFIGS),
+                        help=f"configurations to build (default: all of "
+                             f"{', '.join(CONFIGS)})")
+    args = parser.parse_args()
+    for name in args.configs:
+        if name not in CONFIGS:
+            sys.exit(f"unknown configuration '{name}'")
+
+    scripts = os.path.dirname(os.path.abspath(__file__))
+    source = os.path.dirname(scripts)
+    builddir = os.path.abspath(args.builddir)
+    root = os.path.join(builddir, "synthetic-root")
+
+    exes = {name: build(source, builddir, name, CONFIGS[name])
+            for name in args.configs}
+
+    for name, exe in exes.items():
+        result = subprocess.run([sys.executable,
+                                 os.path.join(scripts, "workload.py"),
+                                 exe, root, "--runs", str(args.runs),
+                                 "--cache"],
+                                stdout=subprocess.PIPE, text=True, check=True)
+        for line in result.stdout.splitlines():
+            print(f"{name}, {line}")
+
+
+if __name__ == "__main__":
+    main()
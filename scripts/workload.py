@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Runs find-untracked-files against a synthetic root, for PGO and benchmarks.
+
+The root is generated on first use: a tree under ROOT/usr with a matching
+local Pacman database under ROOT/var/lib/pacman, plus a share of files and
+symlinks that no package owns, so that both lookup hits and misses are
+exercised. It's left in place afterwards, so later runs measure the tool
+and not the generator.
+"""
+
+import argparse
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import time
+
+# bump when the generated layout changes, so old roots are regenerated
+LAYOUT_VERSION = "1"
+
+
+def generate(root, packages, files, untracked):
+    # mark the root as ours before filling it, so that an interrupted run
+    # can be cleaned up by the next one
+    os.makedirs(root, exist_ok=True)
+    with open(os.path.join(root, ".layout"), "w") as f:
+        f.write("incomplete\n")
+
+    db = os.path.join(root, "var/lib/pacman/local")
+    os.makedirs(db)
+    with open(os.path.join(db, "ALPM_DB_VERSION"), "w") as f:
+        f.write("9\n")
+
+    for p in range(packages):
+        name = f"pkg{p}"
+        owned = ["usr/", "usr/share/", f"usr/share/{name}/"]
+        for d in range(files // 100 + 1):
+            subdir = f"usr/share/{name}/d{d}"
+            owned.append(subdir + "/")
+            os.makedirs(os.path.join(root, subdir))
+
+        for i in range(files):
+            path = f"usr/share/{name}/d{i // 100}/file{i}"
+            owned.append(path)
+            with open(os.path.join(root, path), "w") as f:
+                f.write(path)
+            if i % 10 == 0:
+                link = path + ".link"
+                owned.append(link)
+                os.symlink(f"file{i}", os.path.join(root, link))
+
+        # files left behind by the package, which the tool should report
+        for i in range(untracked):
+            path = f"usr/share/{name}/d0/stray{i}"
+            with open(os.path.join(root, path), "w") as f:
+                f.write(path)
+
+        pkgdir = os.path.join(db, f"{name}-1.0-1")
+        os.mkdir(pkgdir)
+        with open(os.path.join(pkgdir, "desc"), "w") as f:
+            f.write(f"%NAME%\n{name}\n\n%VERSION%\n1.0-1\n\n"
+                    "%ARCH%\nx86_64\n\n%BUILDDATE%\n0\n\n"
+                    "%INSTALLDATE%\n0\n\n%SIZE%\n0\n\n"
+                    "%VALIDATION%\nnone\n\n")
+        with open(os.path.join(pkgdir, "files"), "w") as f:
+            f.write("%FILES%\n" + "\n".join(sorted(owned)) + "\n\n")
+
+    with open(os.path.join(root, ".layout"), "w") as f:
+        f.write(f"{LAYOUT_VERSION} {packages} {files} {untracked}\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("exe", help="find-untracked-files binary to run")
+    parser.add_argument("root", help="directory for the synthetic root")
+    parser.add_argument("--runs", type=int, default=5,
+                        help="number of timed runs (default: 5)")
+    parser.add_argument("--packages", type=int, default=1000,
+                        help="number of packages (default: 1000)")
+    parser.add_argument("--files", type=int, default=200,
+                        help="files per package (default: 200)")
+    parser.add_argument("--untracked", type=int, default=5,
+                        help="untracked files per package (default: 5)")
+    parser.add_argument("--cache", action="store_true",
+                        help="also time runs with --cache, cold and warm")
+    args = parser.parse_args()
+
+    root = os.path.abspath(args.root)
+    layout = f"{LAYOUT_VERSION} {args.packages} {args.files} {args.untracked}\n"
+    try:
+        with open(os.path.join(root, ".layout")) as f:
+            current = f.read() == layout
+        ours = True
+    except FileNotFoundError:
+        current = ours = False
+    if not current:
+        # never delete a directory this script didn't generate
+        if ours:
+            shutil.rmtree(root)
+        elif os.path.isdir(root) and os.listdir(root):
+            sys.exit(f"{root} is not empty and wasn't generated by {sys.argv[0]}, "
+                     "refusing to overwrite it")
+        print(f"Generating synthetic root in {root}...", file=sys.stderr)
+        generate(root, args.packages, args.files, args.untracked)
+
+    # the tool expects a trailing slash on the root
+    cmd = [args.exe, "--root", root + "/",
+           "--db", os.path.join(root, "var/lib/pacman"),
+           os.path.join(root, "usr")]
+
+    expected = args.packages * args.untracked
+    report("no cache", run(cmd, args.runs, expected))
+
+    if args.cache:
+        # inside the root, but outside the tree that's searched
+        cache = os.path.join(root, "var/cache/find-untracked-files")
+        if os.path.exists(cache):
+            shutil.rmtree(cache)
+        cmd[1:1] = ["--cache", cache]
+        report("cache, cold", run(cmd, 1, expected))
+        report("cache, warm", run(cmd, args.runs, expected))
+
+
+def run(cmd, runs, expected):
+    times = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        result = subprocess.run(cmd, stdout=subprocess.PIPE)
+        times.append(time.perf_counter() - start)
+        if result.returncode != 0:
+            sys.exit(f"{cmd[0]} failed with status {result.returncode}")
+
+    found = result.stdout.count(b"\n")
+    if found != expected:
+        sys.exit(f"expected {expected} untracked files, got {found}")
+    return times
+
+
+def report(label, times):
+    print(f"{label}: {len(times)} runs: min {min(times):.3f}s, "
+          f"median {statistics.median(times):.3f}s")
+
+
+if __name__ == "__main__":
+    main()
@@ -8,49 +8,19 @@
 #include <syscall.h>  // for SYS_getdents
 #include <unistd.h>
 
+#include "archive.h"
+#include "catalog.h"
+#include "exec.h"
 #include "walkfd.h"
 
 
-/* A method that walks an open directory file descriptor, checks whether
- * traversed files are in a hashset, and if so, prints them. Returns 0
- * unless an error occurred, otherwise -1. Leaves errno set on error.
- *
- * Parameters:
- *  -> fd: open file descriptor to traverse
- *  -> root: path that the hashset files are relative to (used for printing)
- *  -> rel_path: the path (relative to root) of the currently open directory
- *       note: the hashset only contains the relative path
- *  -> symlinks: whether to print unexpected symlinks (or only files)
- *  -> silent: whether to print permission errors on directories
- *  -> hs: the GHashTable containing all file paths to check against
- *
- * Why use a custom tree walker instead of <fts.h> or <ftw.h>? When using
- *   <fts.h> with FTS_NOSTAT you can't use the DIRENT to distinguish symlinks
- *   from real files. <ftw.h> calls stat on each file.
- *
- * FIXME: we naively traverse the directories and hold open a file descriptor
- *   at each recursion. On sensible modern Arch systems this shouldn't be a
- *   problem, but in theory we could run out.
+/* Handles the entries of the directory open at fd, from its current
+ * offset, for walkfd. Only recurses into subdirectories if dirs is set,
+ * and only checks files if files is set. Returns 0 unless an error
+ * occurred, otherwise -1.
  */
-int walkfd(int fd, char* root, char* rel_path, bool symlinks,
-            bool silent, GHashTable* hs) {
-    if(fd == -1) {
-        // don't fail on access errors, print a warning and continue instead
-        if (errno == EACCES) {
-            if (!silent) {
-                fprintf(stderr,
-                        "Cannot open directory '%s%s': permission denied\n",
-                        root, rel_path);
-            }
-            errno = 0;
-            return 0;
-        } else {
-            fprintf(stderr, "Cannot open directory '%s%s': error %d\n",
-                    root, rel_path, errno);
-            return -1; // treat unknown errors as fatal
-        }
-    }
-
+static int walkentries(int fd, char* rel_path, const struct walkopts* opts,
+                       bool dirs, bool files) {
     // read through every entry in directory
     size_t path_length = strlen(rel_path);
     long nread;
@@ -85,28 +55,50 @@ int walkfd(int fd, char* root, char* rel_path, bool symlinks,
             // FIXME: this arises for (rare) file systems; call stat instead
             if (type == DT_UNKNOWN) {
                 fprintf(stderr, "FAIL: could not get file type of %s%s\n",
-                        root, rel_path);
+                        opts->root, rel_path);
                 return -1;
             }
 
             // recurse
             else if (type == DT_DIR) {
                 // readdir returns POSIX dot files
-                if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+                if (!dirs || !strcmp(entry->d_name, ".")
+                        || !strcmp(entry->d_name, ".."))
                     continue;
 
-                int nextfd = openat(fd, entry->d_name, O_DIRECTORY | O_RDONLY);
-                int wd_err = walkfd(nextfd, root, rel_path, symlinks, silent, hs);
+                int nextfd = openat(fd, entry->d_name,
+                                    O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+                int wd_err = walkfd(nextfd, rel_path, opts);
                 close(nextfd);
                 if (wd_err) {
                     return wd_err;
                 }
             }
 
+            // on a pass for subdirectories only, skip everything else
+            else if (!files) {
+                continue;
+            }
+
             // handle regular files
-            else if (type == DT_REG || (type == DT_LNK && symlinks)) {
-                if (!g_hash_table_contains(hs, rel_path)) {
-                    printf("%s%s\n", root, rel_path);
+            else if (type == DT_REG || (type == DT_LNK && opts->symlinks)) {
+                // the catalog is only consulted for files no package owns
+                if (!g_hash_table_contains(opts->hs, rel_path)
+                        && (opts->generated
+                            || !catalog_contains(rel_path, type == DT_LNK))) {
+                    // archive first, in case the command removes the file
+                    if (opts->archive
+                            && archive_add(opts->archive, fd, entry->d_name,
+                                           rel_path, type == DT_LNK,
+                                           opts->silent))
+                        return -1;
+
+                    if (opts->exec) {
+                        if (exec_batch_add(opts->exec, fd, entry->d_name))
+                            return -1;
+                    } else {
+                        printf("%s%s\n", opts->root, rel_path);
+                    }
                 }
             }
 
@@ -114,6 +106,73 @@ int walkfd(int fd, char* root, char* rel_path, bool symlinks,
         }
     }
 
+    // leave rel_path as we found it, for a second pass
+    rel_path[path_length] = '\0';
+
     // if all directory entries have been handled, then there's no error
     return 0;
 }
+
+
+/* A method that walks an open directory file descriptor, checks whether
+ * traversed files are in a hashset, and if not, prints them (or adds them to
+ * a batch for --exec). Returns 0 unless an error occurred, otherwise -1.
+ * Leaves errno set on error.
+ *
+ * Parameters:
+ *  -> fd: open file descriptor to traverse
+ *  -> rel_path: the path (relative to root) of the currently open directory
+ *       note: the hashset only contains the relative path
+ *  -> opts: settings for the walk
+ *       root: path that the hashset files are relative to (used for printing)
+ *       symlinks: whether to print unexpected symlinks (or only files)
+ *       silent: whether to print permission errors on directories
+ *       generated: whether to print files in the catalog of generated files
+ *       hs: the GHashTable containing all file paths to check against
+ *       exec: if not NULL, untracked files are batched per directory and
+ *         the command is run with the directory as its working directory
+ *       archive: if not NULL, untracked files are also written into it,
+ *         opened relative to fd so they're only looked up once
+ *
+ * Why use a custom tree walker instead of <fts.h> or <ftw.h>? When using
+ *   <fts.h> with FTS_NOSTAT you can't use the DIRENT to distinguish symlinks
+ *   from real files. <ftw.h> calls stat on each file.
+ *
+ * FIXME: we naively traverse the directories and hold open a file descriptor
+ *   at each recursion. On sensible modern Arch systems this shouldn't be a
+ *   problem, but in theory we could run out.
+ */
+int walkfd(int fd, char* rel_path, const struct walkopts* opts) {
+    if(fd == -1) {
+        // don't fail on access errors, print a warning and continue instead
+        if (errno == EACCES) {
+            if (!opts->silent) {
+                fprintf(stderr,
+                        "Cannot open directory '%s%s': permission denied\n",
+                        opts->root, rel_path);
+            }
+            errno = 0;
+            return 0;
+        } else {
+            fprintf(stderr, "Cannot open directory '%s%s': error %d\n",
+                    opts->root, rel_path, errno);
+            return -1; // treat unknown errors as fatal
+        }
+    }
+
+    // with --exec, subdirectories are walked in a second pass over the
+    // entries, so that all of a directory's files go into one batch
+    if (opts->exec) {
+        if (walkentries(fd, rel_path, opts, false, true)
+                || exec_batch_flush(opts->exec, fd))
+            return -1;
+        if (lseek(fd, 0, SEEK_SET) == -1) {
+            fprintf(stderr, "Failed to rewind directory '%s%s'\n",
+                    opts->root, rel_path);
+            return -1;
+        }
+        return walkentries(fd, rel_path, opts, true, false);
+    }
+
+    return walkentries(fd, rel_path, opts, true, true);
+}
@@ -2,6 +2,9 @@
 #include <glib.h>     // for GHashTable
 #include <stdbool.h>
 
+struct archive;
+struct exec_batch;
+
 // struct representing an entry returned by a getdents syscall
 struct linux_dirent {
     unsigned long  d_ino;
@@ -10,5 +13,15 @@ struct linux_dirent {
     char           d_name[];
 };
 
-int walkfd(int fd, char* root, char* rel_path, bool symlinks,
-            bool silent, GHashTable* hs);
+// settings shared by every level of a walk
+struct walkopts {
+    char* root;               // path that the hashset files are relative to
+    bool symlinks;            // whether to report unexpected symlinks
+    bool silent;              // whether to hide permission errors
+    bool generated;           // whether to report known generated files
+    GHashTable* hs;           // all file paths to check against
+    struct exec_batch* exec;  // if set, run a command instead of printing
+    struct archive* archive;  // if set, also write files into this archive
+};
+
+int walkfd(int fd, char* rel_path, const struct walkopts* opts);